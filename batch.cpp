@@ -0,0 +1,200 @@
+#pragma once
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cache.cpp"
+#include "pool.cpp"
+
+using namespace std;
+
+// Simulates every program listed in a manifest and writes one combined CSV.
+// Manifest lines look like "<asm file> <replacement> [bin file]", empty
+// lines and lines starting with '#' are skipped. A job that fails is
+// reported on stderr and in the error column, the others still run.
+class BatchRunner {
+ private:
+  string manifest_file;
+  string csv_file;
+  size_t jobs = thread::hardware_concurrency();
+  bool fast_forward = false;
+
+  vector<ModelConfig> configs;
+  vector<size_t> requests;
+  vector<size_t> lru_hits;
+  vector<size_t> plru_hits;
+  vector<string> errors;
+  bool args_valid = true;
+  bool manifest_opened = false;
+
+  void ParseJobs(const string& arg) {
+    size_t end = 0;
+    long value = 0;
+    try {
+      value = stol(arg, &end);
+    } catch (const logic_error&) {
+    }
+    if (end != arg.size() || value <= 0) {
+      cerr << "bad --jobs value \"" << arg << "\"\n";
+      args_valid = false;
+      return;
+    }
+    jobs = value;
+  }
+
+  void ParseArgs(int argc, char** argv) {
+    for (int i = 1; i + 1 < argc; i += 2) {
+      if (argv[i][2] == 'm') {
+        manifest_file = argv[i + 1];
+      }
+      if (argv[i][2] == 'c') {
+        csv_file = argv[i + 1];
+      }
+      if (argv[i][2] == 'j') {
+        ParseJobs(argv[i + 1]);
+      }
+      if (argv[i][2] == 'f') {
+        fast_forward = argv[i + 1][0] == '1';
+      }
+    }
+  }
+
+  void ReadManifest() {
+    ifstream f(manifest_file);
+    if (!f.is_open()) {
+      cerr << "can not open manifest " << manifest_file << "\n";
+      return;
+    }
+    manifest_opened = true;
+    string line;
+    while (getline(f, line)) {
+      istringstream in(line);
+      ModelConfig config;
+      if (!(in >> config.input_file) || config.input_file[0] == '#') {
+        continue;
+      }
+      string error;
+      if (!(in >> config.replacement) || config.replacement < 0 ||
+          config.replacement > 2) {
+        error = "bad replacement in manifest line \"" + line + "\"";
+      }
+      in >> config.output_file;
+      config.threaded = false;
+      config.fast_forward = fast_forward;
+      configs.push_back(config);
+      errors.push_back(error);
+    }
+    f.close();
+  }
+
+  void WriteRate(ofstream& f, size_t hits, size_t total) {
+    f << hits << ",";
+    if (total != 0) {
+      char rate[32];
+      snprintf(rate, sizeof(rate), "%.4f", (float)hits * 100 / total);
+      f << rate;
+    }
+  }
+
+  void WriteError(ofstream& f, const string& error) {
+    f << "\"";
+    for (char c : error) {
+      f << (c == '"' ? "\"\"" : string(1, c));
+    }
+    f << "\"";
+  }
+
+  void WriteCsv() {
+    ofstream f(csv_file);
+    if (!f.is_open()) {
+      return;
+    }
+    f << "asm,replacement,requests,lru_hits,lru_hit_rate,plru_hits,"
+         "plru_hit_rate,error\n";
+    for (size_t i = 0; i < configs.size(); ++i) {
+      int replacement = configs[i].replacement;
+      f << configs[i].input_file << "," << replacement << ",";
+      if (!errors[i].empty()) {
+        f << ",,,,,";
+        WriteError(f, errors[i]);
+        f << "\n";
+        continue;
+      }
+      f << requests[i] << ",";
+      if (replacement == 0 || replacement == 1) {
+        WriteRate(f, lru_hits[i], requests[i]);
+      } else {
+        f << ",";
+      }
+      f << ",";
+      if (replacement == 0 || replacement == 2) {
+        WriteRate(f, plru_hits[i], requests[i]);
+      } else {
+        f << ",";
+      }
+      f << ",\n";
+    }
+    f.close();
+  }
+
+ public:
+  static bool Requested(int argc, char** argv) {
+    for (int i = 1; i < argc; i += 2) {
+      if (argv[i][2] == 'm') {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  BatchRunner(int argc, char** argv) {
+    ParseArgs(argc, argv);
+    if (!args_valid) {
+      return;
+    }
+    ReadManifest();
+    requests.resize(configs.size());
+    lru_hits.resize(configs.size());
+    plru_hits.resize(configs.size());
+
+    WorkStealingPool pool(jobs);
+    vector<unique_ptr<CacheModel>> models(pool.Workers());
+    for (auto& model : models) {
+      model = make_unique<CacheModel>();
+    }
+    pool.Run(configs.size(), [&](size_t worker, size_t job) {
+      if (!errors[job].empty()) {
+        return;
+      }
+      CacheModel& model = *models[worker];
+      try {
+        model.Run(configs[job]);
+      } catch (const exception& e) {
+        errors[job] = e.what();
+        return;
+      }
+      requests[job] = model.Requests();
+      lru_hits[job] = model.LRUHits();
+      plru_hits[job] = model.pLRUHits();
+    });
+    for (size_t i = 0; i < configs.size(); ++i) {
+      if (!errors[i].empty()) {
+        cerr << configs[i].input_file << ": " << errors[i] << "\n";
+      }
+    }
+    WriteCsv();
+  }
+
+  bool Failed() const {
+    for (const string& error : errors) {
+      if (!error.empty()) {
+        return true;
+      }
+    }
+    return !args_valid || !manifest_opened;
+  }
+};
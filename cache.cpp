@@ -2,10 +2,17 @@
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 #include <map>
+#include <memory>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include "queue.cpp"
+#include "stats.cpp"
+
 using namespace std;
 
 #define MEM_SIZE 262144
@@ -18,8 +25,8 @@ using namespace std;
 #define CACHE_TAG_LEN 8
 #define CACHE_INDEX_LEN 5
 #define CACHE_OFFSET_LEN 5
-
-static uint8_t Mem[MEM_SIZE];
+#define LOOP_MAX_REQUESTS 4096
+#define LOOP_MAX_BACKOFF 1024
 
 static map<string, size_t> CommandId{
     {"add", 0},     {"sub", 1},    {"sll", 2},    {"slt", 3},
@@ -68,6 +75,13 @@ static map<string, size_t> RegId{
     {"s8", 24},  {"s9", 25}, {"s10", 26}, {"s11", 27}, {"t3", 28}, {"t4", 29},
     {"t5", 30},  {"t6", 31}};
 
+// Read-only lookup, so the tables can be shared by simulator threads.
+// Unknown names map to 0, as operator[] used to do.
+static size_t Lookup(const map<string, size_t>& table, const string& name) {
+  auto it = table.find(name);
+  return it == table.end() ? 0 : it->second;
+}
+
 struct Instruction {
   size_t id;
   char type;
@@ -76,7 +90,7 @@ struct Instruction {
   size_t rs2;
   int32_t imm;
 
-  Instruction(string& com) : id(CommandId[com]) {
+  Instruction(string& com) : id(Lookup(CommandId, com)) {
     if (0 <= id and id <= 17) {
       type = 'R';
     } else if (18 <= id and id <= 27) {
@@ -196,14 +210,25 @@ struct CacheLine {
 };
 
 struct CacheBlock {
+  uint8_t* mem = nullptr;
+  size_t mem_size = 0;
   size_t size = 0;
   CacheLine lines[CACHE_WAY];
+  STAT(SetStats stats;)
+
+  void CheckLine(uint32_t adr) {
+    if ((size_t)adr + CACHE_LINE_SIZE > mem_size) {
+      throw out_of_range("cache line at " + to_string(adr) +
+                         " is out of memory");
+    }
+  }
 
   void LoadLine(size_t ind, uint32_t address) {
+    uint32_t adr = (address >> CACHE_OFFSET_LEN) << CACHE_OFFSET_LEN;
+    CheckLine(adr);
     lines[ind].tag_address = address >> (CACHE_INDEX_LEN + CACHE_OFFSET_LEN);
     for (int i = 0; i < CACHE_LINE_SIZE; ++i) {
-      lines[ind].bytes[i] =
-          Mem[((address >> CACHE_OFFSET_LEN) << CACHE_OFFSET_LEN) + i];
+      lines[ind].bytes[i] = mem[adr + i];
     }
   }
 
@@ -211,16 +236,18 @@ struct CacheBlock {
     uint32_t adr =
         ((lines[line_ind].tag_address << CACHE_INDEX_LEN) + block_ind)
         << CACHE_OFFSET_LEN;
+    CheckLine(adr);
     for (int j = 0; j < CACHE_LINE_SIZE; ++j) {
-      Mem[adr + j] = lines[line_ind].bytes[j];
+      mem[adr + j] = lines[line_ind].bytes[j];
     }
   }
 
-  virtual size_t ReplaceLine(uint32_t address) = 0;
+  virtual size_t ReplaceLine() = 0;
 
   virtual void Reset(size_t ind) = 0;
 
   uint8_t Read(uint32_t address, bool& flag) {
+    STAT(++stats.lookups;)
     uint8_t tag_address = address >> (CACHE_INDEX_LEN + CACHE_OFFSET_LEN);
     uint8_t byte_ind = address % (1 << CACHE_OFFSET_LEN);
     for (int i = 0; i < size; ++i) {
@@ -230,8 +257,15 @@ struct CacheBlock {
         return lines[i].bytes[byte_ind];
       }
     }
+    STAT(++stats.fills;)
     if (size == CACHE_WAY) {
-      size_t line_ind = ReplaceLine(address);
+      size_t line_ind = ReplaceLine();
+      STAT(++stats.evictions;)
+      if (lines[line_ind].updated) {
+        STAT(++stats.write_backs;)
+        StoreLine(line_ind,
+                  (address >> CACHE_OFFSET_LEN) % (1 << CACHE_INDEX_LEN));
+      }
       Reset(line_ind);
       LoadLine(line_ind, address);
       lines[line_ind].updated = false;
@@ -247,6 +281,7 @@ struct CacheBlock {
   }
 
   void Write(uint32_t address, uint8_t byte, bool& flag) {
+    STAT(++stats.lookups;)
     uint8_t tag_address = address >> (CACHE_INDEX_LEN + CACHE_OFFSET_LEN);
     uint8_t byte_ind = address % (1 << CACHE_OFFSET_LEN);
     for (int i = 0; i < size; ++i) {
@@ -258,8 +293,15 @@ struct CacheBlock {
         return;
       }
     }
+    STAT(++stats.fills;)
     if (size == CACHE_WAY) {
-      size_t line_ind = ReplaceLine(address);
+      size_t line_ind = ReplaceLine();
+      STAT(++stats.evictions;)
+      if (lines[line_ind].updated) {
+        STAT(++stats.write_backs;)
+        StoreLine(line_ind,
+                  (address >> CACHE_OFFSET_LEN) % (1 << CACHE_INDEX_LEN));
+      }
       Reset(line_ind);
       LoadLine(line_ind, address);
       lines[line_ind].updated = true;
@@ -275,10 +317,38 @@ struct CacheBlock {
     flag = false;
     return;
   }
+
+  // Updates only tags and replacement state, data stays in mem.
+  bool Access(uint32_t address, bool write) {
+    STAT(++stats.lookups;)
+    uint8_t tag_address = address >> (CACHE_INDEX_LEN + CACHE_OFFSET_LEN);
+    for (int i = 0; i < size; ++i) {
+      if (lines[i].tag_address == tag_address) {
+        Reset(i);
+        lines[i].updated = lines[i].updated || write;
+        return true;
+      }
+    }
+    STAT(++stats.fills;)
+    size_t line_ind = size;
+    if (size == CACHE_WAY) {
+      line_ind = ReplaceLine();
+      STAT(++stats.evictions;)
+      STAT(stats.write_backs += lines[line_ind].updated;)
+    } else {
+      ++size;
+    }
+    Reset(line_ind);
+    lines[line_ind].tag_address = tag_address;
+    lines[line_ind].updated = write;
+    return false;
+  }
 };
 
 struct LRUCacheBlock : public CacheBlock {
-  size_t ReplaceLine(uint32_t address) override {
+  static constexpr bool way_order_matters = false;
+
+  size_t ReplaceLine() override {
     size_t max_time = 0;
     size_t line_ind = 0;
     for (int i = 0; i < CACHE_WAY; ++i) {
@@ -287,10 +357,6 @@ struct LRUCacheBlock : public CacheBlock {
         line_ind = i;
       }
     }
-    if (lines[line_ind].updated == true) {
-      size_t block_ind = (address >> CACHE_OFFSET_LEN) % (1 << CACHE_INDEX_LEN);
-      StoreLine(line_ind, block_ind);
-    }
     return line_ind;
   }
 
@@ -303,14 +369,11 @@ struct LRUCacheBlock : public CacheBlock {
 };
 
 struct pLRUCacheBlock : public CacheBlock {
-  size_t ReplaceLine(uint32_t address) override {
+  static constexpr bool way_order_matters = true;
+
+  size_t ReplaceLine() override {
     for (int i = 0; i < size; ++i) {
       if (lines[i].bit == false) {
-        if (lines[i].updated == true) {
-          size_t block_ind =
-              (address >> CACHE_OFFSET_LEN) % (1 << CACHE_INDEX_LEN);
-          StoreLine(i, block_ind);
-        }
         return i;
       }
     }
@@ -331,15 +394,276 @@ struct pLRUCacheBlock : public CacheBlock {
   }
 };
 
+// Simulates one replacement policy, on its own thread unless threaded is
+// false (batch mode already keeps every core busy). Only tags and hit
+// counters are modelled here, loaded values are taken from memory directly.
+//
+// With fast_forward CacheModel records one iteration of a loop and marks it
+// with 'B' and 'E'. The worker records the same requests, their hits and the
+// state of every set they touched. Each following iteration whose requests
+// equal the recorded ones shifted by a constant multiple of CACHE_LINE_SIZE
+// arrives as a single 'I' carrying that shift. If the touched sets start in
+// the recorded state moved by the shift, the iteration must produce the
+// recorded hits and the recorded final state moved the same way, so both are
+// applied at once. Otherwise the shifted requests are simulated one by one
+// and that iteration becomes the recorded one.
+template <typename Block>
+class PolicyWorker {
+ private:
+  Block blocks[CACHE_SETS];
+  SPSCQueue<MemRequest> queue;
+  size_t number_of_hits = 0;
+  thread worker;
+
+  bool recording = false;
+  vector<MemRequest> iteration;
+  size_t iteration_hits = 0;
+  uint32_t touched = 0;  // bit mask of sets used by the recorded iteration
+  uint32_t recorded_offset = 0;  // of the recorded iteration, as in 'I'
+  Block pre[CACHE_SETS];
+  Block post[CACHE_SETS];
+  size_t number_of_skipped = 0;
+  STAT(uint64_t lookup_ticks = 0; size_t lookup_calls = 0;)
+
+  bool Simulate(const MemRequest& req) {
+    bool hit = true;
+    for (int i = 0; i < req.size; ++i) {
+      uint32_t adr = req.address + i;
+      size_t block_ind = (adr >> CACHE_OFFSET_LEN) % (1 << CACHE_INDEX_LEN);
+      if (!blocks[block_ind].Access(adr, req.kind == 'W')) {
+        hit = false;
+      }
+    }
+    if (hit) {
+      ++number_of_hits;
+    }
+    return hit;
+  }
+
+  static uint8_t ShiftTag(uint8_t tag, size_t block_ind, uint32_t shift) {
+    return (((uint32_t)tag << CACHE_INDEX_LEN) + block_ind + shift) >>
+           CACHE_INDEX_LEN;
+  }
+
+  // Ways in the order they are compared: as stored, or from the most to the
+  // least recently used when the policy does not care where a line lives.
+  static void WayOrder(const Block& block, size_t order[CACHE_WAY]) {
+    for (int i = 0; i < CACHE_WAY; ++i) {
+      order[i] = i;
+    }
+    if (Block::way_order_matters) {
+      return;
+    }
+    for (int i = 1; i < block.size; ++i) {
+      for (int j = i; j > 0 && block.lines[order[j]].time <
+                                   block.lines[order[j - 1]].time;
+           --j) {
+        swap(order[j], order[j - 1]);
+      }
+    }
+  }
+
+  // Whether live holds the lines of ref, moved by shift cache lines. LRU
+  // times are compared by order only, that is all ReplaceLine looks at.
+  static bool SameState(const Block& live, const Block& ref, size_t block_ind,
+                        uint32_t shift) {
+    if (live.size != ref.size) {
+      return false;
+    }
+    size_t live_order[CACHE_WAY];
+    size_t ref_order[CACHE_WAY];
+    WayOrder(live, live_order);
+    WayOrder(ref, ref_order);
+    for (int i = 0; i < ref.size; ++i) {
+      const CacheLine& a = live.lines[live_order[i]];
+      const CacheLine& b = ref.lines[ref_order[i]];
+      if (a.tag_address != ShiftTag(b.tag_address, block_ind, shift) ||
+          a.updated != b.updated || a.bit != b.bit) {
+        return false;
+      }
+      for (int j = 0; j < ref.size; ++j) {
+        if ((a.time < live.lines[live_order[j]].time) !=
+            (b.time < ref.lines[ref_order[j]].time)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  bool SteadyState(uint32_t shift) const {
+    for (int i = 0; i < CACHE_SETS; ++i) {
+      if ((touched >> i) & 1) {
+        if (!SameState(blocks[(i + shift) % CACHE_SETS], pre[i], i, shift)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  void Commit(uint32_t shift) {
+    for (int i = 0; i < CACHE_SETS; ++i) {
+      if (((touched >> i) & 1) == 0) {
+        continue;
+      }
+      Block& live = blocks[(i + shift) % CACHE_SETS];
+      STAT(live.stats.lookups += post[i].stats.lookups - pre[i].stats.lookups;)
+      STAT(live.stats.fills += post[i].stats.fills - pre[i].stats.fills;)
+      STAT(live.stats.write_backs +=
+           post[i].stats.write_backs - pre[i].stats.write_backs;)
+      STAT(live.stats.evictions +=
+           post[i].stats.evictions - pre[i].stats.evictions;)
+      live.size = post[i].size;
+      for (int j = 0; j < CACHE_WAY; ++j) {
+        live.lines[j] = post[i].lines[j];
+        live.lines[j].tag_address =
+            ShiftTag(post[i].lines[j].tag_address, i, shift);
+      }
+    }
+    number_of_hits += iteration_hits;
+    ++number_of_skipped;
+  }
+
+  void SavePre(const MemRequest& req) {
+    for (int i = 0; i < req.size; ++i) {
+      size_t block_ind =
+          ((req.address + i) >> CACHE_OFFSET_LEN) % (1 << CACHE_INDEX_LEN);
+      if (((touched >> block_ind) & 1) == 0) {
+        touched |= 1u << block_ind;
+        pre[block_ind] = blocks[block_ind];
+      }
+    }
+  }
+
+  void SavePost() {
+    for (int i = 0; i < CACHE_SETS; ++i) {
+      if ((touched >> i) & 1) {
+        post[i] = blocks[i];
+      }
+    }
+  }
+
+  void Record(const MemRequest& req) {
+    SavePre(req);
+    if (Simulate(req)) {
+      ++iteration_hits;
+    }
+    iteration.push_back(req);
+  }
+
+  // One more iteration equal to the first recorded one moved by offset bytes.
+  void Repeat(uint32_t offset) {
+    uint32_t shift = (offset - recorded_offset) / CACHE_LINE_SIZE;
+    if (SteadyState(shift)) {
+      Commit(shift);
+      return;
+    }
+    touched = 0;
+    iteration_hits = 0;
+    for (MemRequest& req : iteration) {
+      req.address += offset - recorded_offset;
+      SavePre(req);
+      if (Simulate(req)) {
+        ++iteration_hits;
+      }
+    }
+    SavePost();
+    recorded_offset = offset;
+  }
+
+  void Handle(const MemRequest& req) {
+    STAT(SampledTimer timer(lookup_ticks, lookup_calls);)
+    switch (req.kind) {
+      case 'B':
+        recording = true;
+        iteration.clear();
+        iteration_hits = 0;
+        touched = 0;
+        recorded_offset = 0;
+        break;
+      case 'E':
+        recording = false;
+        SavePost();
+        break;
+      case 'I':
+        Repeat(req.address);
+        break;
+      default:
+        if (recording && iteration.size() < LOOP_MAX_REQUESTS) {
+          Record(req);
+        } else {
+          Simulate(req);
+        }
+    }
+  }
+
+  void Run() {
+    for (MemRequest req = queue.Pop(); req.kind != 'F'; req = queue.Pop()) {
+      Handle(req);
+    }
+  }
+
+ public:
+  PolicyWorker(bool threaded) {
+    if (threaded) {
+      worker = thread(&PolicyWorker::Run, this);
+    }
+  }
+
+  ~PolicyWorker() {
+    if (worker.joinable()) {
+      Finish();
+    }
+  }
+
+  void Publish(uint32_t address, size_t size, char kind) {
+    if (worker.joinable()) {
+      queue.Push({address, (uint8_t)size, kind});
+    } else {
+      Handle({address, (uint8_t)size, kind});
+    }
+  }
+
+  const Block* Blocks() const { return blocks; }
+
+  size_t Skipped() const { return number_of_skipped; }
+
+  STAT(uint64_t LookupTicks() const { return lookup_ticks; })
+
+  size_t Finish() {
+    if (worker.joinable()) {
+      queue.Push({0, 0, 'F'});
+      worker.join();
+    }
+    return number_of_hits;
+  }
+};
+
+struct ModelConfig {
+  int replacement = 0;
+  string input_file;
+  string output_file;
+  string stats_file;
+  bool threaded = true;
+  bool fast_forward = false;
+};
+
 class CacheModel {
  private:
   int replacement;
   string input_file;
   string output_file;
+  string stats_file;
+  bool threaded = true;
+  bool fast_forward = false;
 
+  vector<uint8_t> mem;
   uint32_t regs[32];
   LRUCacheBlock LRUblocks[CACHE_SETS];
   pLRUCacheBlock pLRUblocks[CACHE_SETS];
+  unique_ptr<PolicyWorker<LRUCacheBlock>> lru_worker;
+  unique_ptr<PolicyWorker<pLRUCacheBlock>> plru_worker;
 
   size_t number_of_lru_hits = 0;
   size_t number_of_plru_hits = 0;
@@ -347,6 +671,18 @@ class CacheModel {
 
   vector<Instruction> program;
 
+  // Loop fast-forward, see PolicyWorker.
+  char loop_state = 'W';  // 'W' wait for a back-edge, 'R' record, 'V' verify
+  uint32_t loop_pc = 0;
+  vector<MemRequest> loop_iteration;
+  size_t loop_verified = 0;  // requests of the current iteration matched
+  uint32_t loop_repeats = 0;
+  uint32_t loop_stride = 0;
+  vector<uint32_t> loop_backoff;  // by instruction index of the back-edge
+  vector<uint32_t> loop_skip;
+
+  STAT(ModelStats stats;)
+
   void Low(string& inst) {
     for (int i = 0; i < inst.size(); ++i) {
       if (isupper(inst[i])) inst[i] = tolower(inst[i]);
@@ -354,14 +690,145 @@ class CacheModel {
   }
 
   int32_t Convert(const string& arg) {
-    if (arg.size() > 2 && (arg[1] == 'x' || (arg[0] == '-' && arg[2] == 'x'))) {
-      return stoi(arg.substr(2), nullptr, 16);
+    try {
+      if (arg.size() > 2 &&
+          (arg[1] == 'x' || (arg[0] == '-' && arg[2] == 'x'))) {
+        return stoi(arg.substr(2), nullptr, 16);
+      }
+      return stoi(arg);
+    } catch (const logic_error&) {
+      throw invalid_argument("bad immediate \"" + arg + "\"");
     }
-    return stoi(arg);
+  }
+
+  void CheckAddress(uint32_t address, size_t size) {
+    if ((size_t)address + size > mem.size()) {
+      throw out_of_range("memory access at " + to_string(address) + " of " +
+                         to_string(size) + " bytes is out of memory");
+    }
+  }
+
+  // x86 traps on a division by zero and would take the whole process down,
+  // batch included, so it is reported as an error of this program instead.
+  uint32_t Divisor(size_t i) {
+    if (regs[program[i].rs2] == 0) {
+      throw domain_error("division by zero at instruction " + to_string(i));
+    }
+    return regs[program[i].rs2];
+  }
+
+  void Publish(uint32_t address, size_t size, char kind) {
+    if (lru_worker) {
+      lru_worker->Publish(address, size, kind);
+    }
+    if (plru_worker) {
+      plru_worker->Publish(address, size, kind);
+    }
+  }
+
+  bool LoopMatches(const MemRequest& req) {
+    if (loop_verified == loop_iteration.size()) {
+      return false;
+    }
+    const MemRequest& ref = loop_iteration[loop_verified];
+    if (req.size != ref.size || req.kind != ref.kind) {
+      return false;
+    }
+    if (loop_verified == 0 && loop_repeats == 1) {
+      loop_stride = req.address - ref.address;
+      if (loop_stride % CACHE_LINE_SIZE != 0) {
+        return false;
+      }
+    }
+    return req.address == ref.address + loop_repeats * loop_stride;
+  }
+
+  // Publishes the requests matched so far and stops verifying. A loop that
+  // did not repeat even once is not recorded again for a while.
+  void LoopFallback() {
+    uint32_t offset = loop_repeats * loop_stride;
+    for (size_t i = 0; i < loop_verified; ++i) {
+      const MemRequest& ref = loop_iteration[i];
+      Publish(ref.address + offset, ref.size, ref.kind);
+    }
+    if (loop_repeats == 1) {
+      loop_backoff[loop_pc] =
+          min<uint32_t>(loop_backoff[loop_pc] * 2, LOOP_MAX_BACKOFF);
+      loop_skip[loop_pc] = loop_backoff[loop_pc];
+    }
+    loop_state = 'W';
+  }
+
+  // Returns true when req repeats the recorded iteration and must not be
+  // published.
+  bool LoopRequest(const MemRequest& req) {
+    if (loop_state == 'V') {
+      if (LoopMatches(req)) {
+        ++loop_verified;
+        return true;
+      }
+      LoopFallback();
+    }
+    if (loop_state == 'R') {
+      if (loop_iteration.size() < LOOP_MAX_REQUESTS) {
+        loop_iteration.push_back(req);
+      } else {
+        loop_state = 'W';
+      }
+    }
+    return false;
+  }
+
+  // Taken backward branch at instruction pc. Back-edges of other loops
+  // inside the tracked one are part of its iteration.
+  void LoopBackEdge(uint32_t pc) {
+    if (loop_state == 'V') {
+      if (pc != loop_pc) {
+        return;
+      }
+      if (loop_verified == loop_iteration.size()) {
+        if (!loop_iteration.empty()) {
+          Publish(loop_repeats * loop_stride, 0, 'I');
+        }
+        ++loop_repeats;
+        loop_verified = 0;
+        loop_backoff[pc] = 1;
+        return;
+      }
+      LoopFallback();
+    }
+    if (loop_state == 'R' && pc == loop_pc) {
+      Publish(0, 0, 'E');
+      loop_state = 'V';
+      loop_verified = 0;
+      loop_repeats = 1;
+      loop_stride = 0;
+      return;
+    }
+    if (loop_skip[pc] > 0) {
+      --loop_skip[pc];
+      return;
+    }
+    loop_state = 'R';
+    loop_pc = pc;
+    loop_iteration.clear();
+    Publish(0, 0, 'B');
   }
 
   void Write(uint32_t address, uint32_t bytes, size_t size) {
+    STAT(SampledTimer timer(stats.memory_ticks, stats.memory_calls);)
+    CheckAddress(address, size);
     ++number_of_requests;
+    if (replacement == 0 || fast_forward) {
+      if (!(fast_forward && LoopRequest({address, (uint8_t)size, 'W'}))) {
+        Publish(address, size, 'W');
+      }
+      for (int i = 0; i < size; ++i) {
+        mem[address + i] = bytes % (1 << 8);
+        bytes >>= 8;
+      }
+      return;
+    }
     bool LRUhit = true;
     bool pLRUhit = true;
     for (int i = 0; i < size; ++i) {
@@ -393,7 +860,20 @@ class CacheModel {
   }
 
   uint32_t Read(uint32_t address, size_t size) {
+    STAT(SampledTimer timer(stats.memory_ticks, stats.memory_calls);)
+    CheckAddress(address, size);
     ++number_of_requests;
+    if (replacement == 0 || fast_forward) {
+      if (!(fast_forward && LoopRequest({address, (uint8_t)size, 'R'}))) {
+        Publish(address, size, 'R');
+      }
+      uint32_t ans = 0;
+      for (int i = size - 1; i >= 0; --i) {
+        ans <<= 8;
+        ans += mem[address + i];
+      }
+      return ans;
+    }
     bool LRUhit = true;
     bool pLRUhit = true;
     vector<uint8_t> bytes1;
@@ -461,11 +941,21 @@ class CacheModel {
       if (argv[i][2] == 'b') {
         output_file = argv[i + 1];
       }
+      if (argv[i][2] == 's') {
+        stats_file = argv[i + 1];
+      }
+      if (argv[i][2] == 'f') {
+        fast_forward = argv[i + 1][0] == '1';
+      }
     }
   }
 
-  void ReadFile() {
+  bool ReadFile() {
+    STAT(PhaseTimer timer(stats.read_file_ns);)
     ifstream f(input_file);
+    if (!f.is_open()) {
+      return false;
+    }
     string com;
     while (f >> com) {
       Low(com);
@@ -488,41 +978,43 @@ class CacheModel {
       }
       switch (inst.type) {
         case 'R':
-          inst.rd = RegId[arg1];
-          inst.rs1 = RegId[arg2];
-          inst.rs2 = RegId[arg3];
+          inst.rd = Lookup(RegId, arg1);
+          inst.rs1 = Lookup(RegId, arg2);
+          inst.rs2 = Lookup(RegId, arg3);
           break;
         case 'I':
-          inst.rd = RegId[arg1];
-          inst.rs1 = RegId[arg2];
+          inst.rd = Lookup(RegId, arg1);
+          inst.rs1 = Lookup(RegId, arg2);
           inst.imm = Convert(arg3);
           break;
         case 'L':
-          inst.rd = RegId[arg1];
-          inst.rs1 = RegId[arg3];
+          inst.rd = Lookup(RegId, arg1);
+          inst.rs1 = Lookup(RegId, arg3);
           inst.imm = Convert(arg2);
           break;
         case 'S':
-          inst.rs1 = RegId[arg3];
-          inst.rs2 = RegId[arg1];
+          inst.rs1 = Lookup(RegId, arg3);
+          inst.rs2 = Lookup(RegId, arg1);
           inst.imm = Convert(arg2);
           break;
         case 'B':
-          inst.rs1 = RegId[arg1];
-          inst.rs2 = RegId[arg2];
+          inst.rs1 = Lookup(RegId, arg1);
+          inst.rs2 = Lookup(RegId, arg2);
           inst.imm = Convert(arg3);
           break;
         case 'U':
-          inst.rd = RegId[arg1];
+          inst.rd = Lookup(RegId, arg1);
           inst.imm = Convert(arg2);
           break;
       }
       program.push_back(inst);
     }
     f.close();
+    return true;
   }
 
   void Code() {
+    STAT(PhaseTimer timer(stats.code_ns);)
     ofstream f;
     f.open(output_file, ios::binary);
     if (!f.is_open()) {
@@ -538,10 +1030,97 @@ class CacheModel {
     f.close();
   }
 
+#ifdef CASH_STATS
+  template <typename Block>
+  void DumpPolicy(ofstream& f, const string& name, size_t hits,
+                  size_t skipped, uint64_t lookup_ticks, const Block* blocks) {
+    f << "    \"" << name << "\": {\n";
+    f << "      \"hits\": " << hits << ",\n";
+    f << "      \"lookup_ticks\": " << lookup_ticks << ",\n";
+    f << "      \"fast_forwarded_iterations\": " << skipped << ",\n";
+    f << "      \"sets\": [\n";
+    for (int i = 0; i < CACHE_SETS; ++i) {
+      const SetStats& set = blocks[i].stats;
+      f << "        {\"lookups\": " << set.lookups
+        << ", \"fills\": " << set.fills
+        << ", \"write_backs\": " << set.write_backs
+        << ", \"evictions\": " << set.evictions << "}"
+        << (i + 1 < CACHE_SETS ? ",\n" : "\n");
+    }
+    f << "      ]\n";
+    f << "    }";
+  }
+#endif
+
+  void DumpStats() {
+    if (stats_file.empty()) {
+      return;
+    }
+#ifdef CASH_STATS
+    ofstream f(stats_file);
+    if (!f.is_open()) {
+      return;
+    }
+    f << "{\n";
+    f << "  \"replacement\": " << replacement << ",\n";
+    f << "  \"requests\": " << number_of_requests << ",\n";
+    f << "  \"phases_ns\": {\"read_file\": " << stats.read_file_ns
+      << ", \"code\": " << stats.code_ns
+      << ", \"modeling\": " << stats.modeling_ns << "},\n";
+    // Interpreter side of memory requests. With a PolicyWorker that is only
+    // publishing, the lookups themselves are in each policy's lookup_ticks.
+    f << "  \"memory_ticks\": " << stats.memory_ticks << ",\n";
+    f << "  \"tick_unit\": \"" << TICK_UNIT << "\",\n";
+    f << "  \"instructions\": {";
+    for (int type = 0; type < INSTRUCTION_TYPE_COUNT; ++type) {
+      f << (type == 0 ? "" : ", ") << "\"" << INSTRUCTION_TYPES[type]
+        << "\": " << stats.instructions[type];
+    }
+    f << "},\n";
+    f << "  \"policies\": {\n";
+    if (lru_worker) {
+      DumpPolicy(f, "LRU", number_of_lru_hits, lru_worker->Skipped(),
+                 lru_worker->LookupTicks(), lru_worker->Blocks());
+    } else if (replacement == 1) {
+      DumpPolicy(f, "LRU", number_of_lru_hits, 0, stats.memory_ticks,
+                 LRUblocks);
+    }
+    if (replacement == 0) {
+      f << ",\n";
+    }
+    if (plru_worker) {
+      DumpPolicy(f, "pLRU", number_of_plru_hits, plru_worker->Skipped(),
+                 plru_worker->LookupTicks(), plru_worker->Blocks());
+    } else if (replacement == 2) {
+      DumpPolicy(f, "pLRU", number_of_plru_hits, 0, stats.memory_ticks,
+                 pLRUblocks);
+    }
+    f << "\n  }\n";
+    f << "}\n";
+    f.close();
+#else
+    cerr << "Stats are disabled at compile time, rebuild with CASH_STATS\n";
+#endif
+  }
+
   void Modeling() {
+    STAT(PhaseTimer timer(stats.modeling_ns);)
+    if (replacement == 0 || fast_forward) {
+      bool own_threads = threaded && replacement == 0;
+      if (replacement == 0 || replacement == 1) {
+        lru_worker = make_unique<PolicyWorker<LRUCacheBlock>>(own_threads);
+      }
+      if (replacement == 0 || replacement == 2) {
+        plru_worker = make_unique<PolicyWorker<pLRUCacheBlock>>(own_threads);
+      }
+    }
+    loop_backoff.assign(program.size(), 1);
+    loop_skip.assign(program.size(), 0);
     regs[1] = program.size() * 4;
     for (int i = 0; i < program.size(); ++i) {
       regs[0] = 0;
+      STAT(++stats.instructions[InstructionType(program[i].type)];)
+      int pc = i;
       {
         switch (program[i].id) {
           case 0:
@@ -595,16 +1174,16 @@ class CacheModel {
                                   32;
             break;
           case 14:
-            regs[program[i].rd] = regs[program[i].rs1] / regs[program[i].rs2];
+            regs[program[i].rd] = regs[program[i].rs1] / Divisor(i);
             break;
           case 15:
-            regs[program[i].rd] = regs[program[i].rs1] / regs[program[i].rs2];
+            regs[program[i].rd] = regs[program[i].rs1] / Divisor(i);
             break;
           case 16:
-            regs[program[i].rd] = regs[program[i].rs1] % regs[program[i].rs2];
+            regs[program[i].rd] = regs[program[i].rs1] % Divisor(i);
             break;
           case 17:
-            regs[program[i].rd] = regs[program[i].rs1] % regs[program[i].rs2];
+            regs[program[i].rd] = regs[program[i].rs1] % Divisor(i);
             break;
           case 18:
             regs[program[i].rd] = regs[program[i].rs1] + program[i].imm;
@@ -717,8 +1296,45 @@ class CacheModel {
             break;
         }
       }
+      if (fast_forward && i < pc) {
+        LoopBackEdge(pc);
+      }
+    }
+    if (loop_state == 'V') {
+      LoopFallback();
     }
     StoreCash();
+    if (lru_worker) {
+      number_of_lru_hits = lru_worker->Finish();
+    }
+    if (plru_worker) {
+      number_of_plru_hits = plru_worker->Finish();
+    }
+  }
+
+  void ResetState() {
+    fill(mem.begin(), mem.end(), 0);
+    fill(regs, regs + 32, 0);
+    for (int i = 0; i < CACHE_SETS; ++i) {
+      LRUblocks[i] = LRUCacheBlock();
+      LRUblocks[i].mem = mem.data();
+      LRUblocks[i].mem_size = mem.size();
+      pLRUblocks[i] = pLRUCacheBlock();
+      pLRUblocks[i].mem = mem.data();
+      pLRUblocks[i].mem_size = mem.size();
+    }
+    lru_worker.reset();
+    plru_worker.reset();
+    number_of_lru_hits = 0;
+    number_of_plru_hits = 0;
+    number_of_requests = 0;
+    program.clear();
+    loop_state = 'W';
+    loop_iteration.clear();
+    STAT(stats = ModelStats();)
+  }
+
+  void PrintHitRates() {
     if (replacement == 0) {
       printf("LRU\thit rate: %3.4f%%\npLRU\thit rate: %3.4f%%\n",
              (float)number_of_lru_hits * 100 / number_of_requests,
@@ -733,10 +1349,39 @@ class CacheModel {
   }
 
  public:
-  CacheModel(int argc, char** argv) {
+  CacheModel() : mem(MEM_SIZE) {}
+
+  CacheModel(int argc, char** argv) : mem(MEM_SIZE) {
     ParseArgs(argc, argv);
+    ResetState();
     ReadFile();
     Code();
     Modeling();
+    DumpStats();
+    PrintHitRates();
   }
+
+  // Simulates one more program, reusing the memory and caches of this
+  // instance. Throws if the program can not be read or parsed.
+  void Run(const ModelConfig& config) {
+    replacement = config.replacement;
+    input_file = config.input_file;
+    output_file = config.output_file;
+    stats_file = config.stats_file;
+    threaded = config.threaded;
+    fast_forward = config.fast_forward;
+    ResetState();
+    if (!ReadFile()) {
+      throw runtime_error("can not open " + input_file);
+    }
+    Code();
+    Modeling();
+    DumpStats();
+  }
+
+  size_t Requests() const { return number_of_requests; }
+
+  size_t LRUHits() const { return number_of_lru_hits; }
+
+  size_t pLRUHits() const { return number_of_plru_hits; }
 };
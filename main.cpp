@@ -1,5 +1,17 @@
 #include <iostream>
 
+#include "batch.cpp"
 #include "cache.cpp"
 
-int main(int argc, char** argv) { CacheModel c(argc, argv); }
\ No newline at end of file
+int main(int argc, char** argv) {
+  if (BatchRunner::Requested(argc, argv)) {
+    BatchRunner b(argc, argv);
+    return b.Failed() ? 1 : 0;
+  }
+  try {
+    CacheModel c(argc, argv);
+  } catch (const exception& e) {
+    cerr << e.what() << "\n";
+    return 1;
+  }
+}
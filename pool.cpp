@@ -0,0 +1,71 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+// Runs a fixed set of jobs on a number of threads. Every thread starts with
+// its own share of the jobs and, once it runs out, steals from the back of
+// the other threads' queues.
+class WorkStealingPool {
+ private:
+  size_t number_of_workers;
+  vector<deque<size_t>> queues;
+  unique_ptr<mutex[]> locks;
+
+  bool TakeOwn(size_t worker, size_t& job) {
+    lock_guard<mutex> lock(locks[worker]);
+    if (queues[worker].empty()) {
+      return false;
+    }
+    job = queues[worker].front();
+    queues[worker].pop_front();
+    return true;
+  }
+
+  bool Steal(size_t worker, size_t& job) {
+    for (size_t i = 1; i < number_of_workers; ++i) {
+      size_t victim = (worker + i) % number_of_workers;
+      lock_guard<mutex> lock(locks[victim]);
+      if (!queues[victim].empty()) {
+        job = queues[victim].back();
+        queues[victim].pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+
+ public:
+  WorkStealingPool(size_t workers)
+      : number_of_workers(workers == 0 ? 1 : workers),
+        queues(number_of_workers),
+        locks(new mutex[number_of_workers]) {}
+
+  size_t Workers() const { return number_of_workers; }
+
+  // Calls task(worker, job) for every job in [0, jobs) and waits for all of
+  // them. Jobs never add new jobs, so a worker that finds every queue empty
+  // is done.
+  void Run(size_t jobs, const function<void(size_t, size_t)>& task) {
+    for (size_t job = 0; job < jobs; ++job) {
+      queues[job % number_of_workers].push_back(job);
+    }
+    vector<thread> threads;
+    for (size_t worker = 0; worker < number_of_workers; ++worker) {
+      threads.emplace_back([this, worker, &task]() {
+        size_t job;
+        while (TakeOwn(worker, job) || Steal(worker, job)) {
+          task(worker, job);
+        }
+      });
+    }
+    for (thread& t : threads) {
+      t.join();
+    }
+  }
+};
@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+using namespace std;
+
+#define QUEUE_SIZE 4096
+#define HARDWARE_LINE_SIZE 64
+
+struct MemRequest {
+  uint32_t address;  // byte offset for 'I'
+  uint8_t size;
+  char kind;  // 'R' read, 'W' write, 'F' finished, 'B' 'E' 'I' loop events
+};
+
+// Lock-free ring buffer for exactly one producer and one consumer thread.
+// QUEUE_SIZE must be a power of two.
+template <typename T>
+class SPSCQueue {
+ private:
+  alignas(HARDWARE_LINE_SIZE) atomic<size_t> head{0};
+  size_t cached_tail = 0;
+  alignas(HARDWARE_LINE_SIZE) atomic<size_t> tail{0};
+  size_t cached_head = 0;
+  alignas(HARDWARE_LINE_SIZE) T items[QUEUE_SIZE];
+
+ public:
+  void Push(const T& item) {
+    size_t t = tail.load(memory_order_relaxed);
+    while (t - cached_head == QUEUE_SIZE) {
+      cached_head = head.load(memory_order_acquire);
+      if (t - cached_head == QUEUE_SIZE) {
+        this_thread::yield();
+      }
+    }
+    items[t % QUEUE_SIZE] = item;
+    tail.store(t + 1, memory_order_release);
+  }
+
+  T Pop() {
+    size_t h = head.load(memory_order_relaxed);
+    while (h == cached_tail) {
+      cached_tail = tail.load(memory_order_acquire);
+      if (h == cached_tail) {
+        this_thread::yield();
+      }
+    }
+    T item = items[h % QUEUE_SIZE];
+    head.store(h + 1, memory_order_release);
+    return item;
+  }
+};
@@ -0,0 +1,99 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+using namespace std;
+
+// Self-profiling is compiled in only with CASH_STATS, otherwise every
+// STAT(...) statement disappears from the hot paths.
+#ifdef CASH_STATS
+#define STAT(...) __VA_ARGS__
+#else
+#define STAT(...)
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TICK_UNIT "cycles"
+#else
+#define TICK_UNIT "ns"
+#endif
+
+#define STAT_SAMPLE_PERIOD 64
+
+// Instruction::type letters, in the order they are counted and dumped.
+#define INSTRUCTION_TYPES "RILSBUE"
+#define INSTRUCTION_TYPE_COUNT (sizeof(INSTRUCTION_TYPES) - 1)
+
+inline size_t InstructionType(char type) {
+  return strchr(INSTRUCTION_TYPES, type) - INSTRUCTION_TYPES;
+}
+
+inline uint64_t ReadTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return chrono::duration_cast<chrono::nanoseconds>(
+             chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+struct SetStats {
+  size_t lookups = 0;
+  size_t fills = 0;
+  size_t write_backs = 0;
+  size_t evictions = 0;
+};
+
+struct ModelStats {
+  uint64_t read_file_ns = 0;
+  uint64_t code_ns = 0;
+  uint64_t modeling_ns = 0;
+  uint64_t memory_ticks = 0;
+  size_t memory_calls = 0;
+  size_t instructions[INSTRUCTION_TYPE_COUNT] = {};  // by InstructionType
+};
+
+// Adds the wall-clock time of a scope to slot, in nanoseconds.
+class PhaseTimer {
+ private:
+  uint64_t& slot;
+  chrono::steady_clock::time_point start;
+
+ public:
+  PhaseTimer(uint64_t& slot) : slot(slot), start(chrono::steady_clock::now()) {}
+
+  ~PhaseTimer() {
+    slot += chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - start)
+                .count();
+  }
+};
+
+// Timer for short hot scopes. Only one call in STAT_SAMPLE_PERIOD reads the
+// clock, its elapsed TICK_UNITs are added to slot scaled by the period.
+class SampledTimer {
+ private:
+  uint64_t& slot;
+  bool sampled;
+  uint64_t start = 0;
+
+ public:
+  SampledTimer(uint64_t& slot, size_t& calls)
+      : slot(slot), sampled(calls++ % STAT_SAMPLE_PERIOD == 0) {
+    if (sampled) {
+      start = ReadTicks();
+    }
+  }
+
+  ~SampledTimer() {
+    if (sampled) {
+      slot += (ReadTicks() - start) * STAT_SAMPLE_PERIOD;
+    }
+  }
+};
@@ -0,0 +1,45 @@
+# Runs CASH in batch mode on GOOD, an out-of-bounds store and a division by
+# zero. The batch must fail, but still write every row: GOOD with the hit
+# rates of a single-program run, the other two with the error column filled.
+set(manifest ${OUT}manifest.txt)
+set(csv ${OUT}batch.csv)
+file(WRITE ${manifest}
+  "${GOOD} 0\n${TESTS}/out_of_bounds.asm 0\n${TESTS}/div_zero.asm 1\n")
+file(REMOVE ${csv})
+execute_process(
+  COMMAND ${CASH} --manifest ${manifest} --csv ${csv} --jobs 2
+  RESULT_VARIABLE result
+  ERROR_VARIABLE errors)
+if(NOT result EQUAL 1)
+  message(FATAL_ERROR "batch exited with ${result}, expected 1:\n${errors}")
+endif()
+
+execute_process(
+  COMMAND ${CASH} --replacement 0 --asm ${GOOD}
+  OUTPUT_VARIABLE single
+  RESULT_VARIABLE result)
+if(NOT result EQUAL 0)
+  message(FATAL_ERROR "cash failed with ${result}")
+endif()
+string(REGEX MATCHALL "[0-9.]+%" rates "${single}")
+string(REPLACE "%" "" rates "${rates}")
+list(GET rates 0 lru)
+list(GET rates 1 plru)
+
+file(STRINGS ${csv} rows)
+list(LENGTH rows count)
+if(NOT count EQUAL 4)
+  message(FATAL_ERROR "expected a header and 3 rows in ${csv}")
+endif()
+list(GET rows 1 good)
+if(NOT good MATCHES "^${GOOD},0,[0-9]+,[0-9]+,${lru},[0-9]+,${plru},$")
+  message(FATAL_ERROR "row \"${good}\" does not match:\n${single}")
+endif()
+list(GET rows 2 out_of_bounds)
+if(NOT out_of_bounds MATCHES ",0,,,,,,\".*out of memory\"$")
+  message(FATAL_ERROR "no error in row \"${out_of_bounds}\"")
+endif()
+list(GET rows 3 div_zero)
+if(NOT div_zero MATCHES ",1,,,,,,\"division by zero.*\"$")
+  message(FATAL_ERROR "no error in row \"${div_zero}\"")
+endif()
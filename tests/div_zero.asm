@@ -0,0 +1,3 @@
+ADDI   	t0, zero, 7
+DIV    	t1, t0, zero
+JALR   	zero, ra, 0
@@ -0,0 +1,36 @@
+# Runs CASH on KERNEL with and without --fast-forward and checks that the
+# hit rates match. When stats are built in, every per-set counter must match
+# too, and with EXPECT_SKIP some iterations must have been fast-forwarded.
+foreach(ff 0 1)
+  file(REMOVE ${OUT}${ff}.json)
+  execute_process(
+    COMMAND ${CASH} --replacement ${REPLACEMENT} --asm ${KERNEL}
+            --fast-forward ${ff} --stats-json ${OUT}${ff}.json
+    OUTPUT_VARIABLE output${ff}
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "cash failed with ${result}")
+  endif()
+endforeach()
+
+if(NOT output0 STREQUAL output1)
+  message(FATAL_ERROR "hit rates differ:\n${output0}\nvs\n${output1}")
+endif()
+
+if(NOT EXISTS ${OUT}0.json)
+  return()
+endif()
+foreach(ff 0 1)
+  file(STRINGS ${OUT}${ff}.json stats${ff})
+  list(FILTER stats${ff} EXCLUDE REGEX "_ns|ticks|fast_forwarded")
+endforeach()
+if(NOT stats0 STREQUAL stats1)
+  message(FATAL_ERROR "stats differ, see ${OUT}0.json and ${OUT}1.json")
+endif()
+
+if(EXPECT_SKIP)
+  file(STRINGS ${OUT}1.json skipped REGEX "fast_forwarded_iterations\": 0,")
+  if(skipped)
+    message(FATAL_ERROR "a policy fast-forwarded no iterations")
+  endif()
+endif()
@@ -0,0 +1,4 @@
+ADDI   	a1, zero, 1
+LUI    	a0, 64
+SW     	a1, 16, a0
+JALR   	zero, ra, 0
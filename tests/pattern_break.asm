@@ -0,0 +1,13 @@
+ADDI   	t0, zero, 1000
+ADDI   	t1, zero, 0
+ADDI   	a0, zero, 256
+ADDI   	t2, zero, 500
+LW     	s1, 0, a0
+BNE    	t1, t2, 8
+LW     	s2, 1500, a0
+SW     	s1, 4, a0
+ADDI   	t1, t1, 1
+BLT    	t1, t0, -20
+LW     	s1, 1500, a0
+LW     	s1, 1248, a0
+JALR   	zero, ra, 0
@@ -0,0 +1,9 @@
+ADDI   	t0, zero, 1000
+ADDI   	t1, zero, 0
+LUI    	a0, 16
+LW     	s1, 0, a0
+SW     	s1, 8, a0
+ADDI   	a0, a0, -64
+ADDI   	t1, t1, 1
+BLT    	t1, t0, -16
+JALR   	zero, ra, 0
@@ -0,0 +1,11 @@
+ADDI   	t0, zero, 2000
+ADDI   	t1, zero, 0
+ADDI   	a0, zero, 0
+LW     	s1, 0, a0
+LH     	s2, 4, a0
+SW     	s1, 8, a0
+LB     	s3, 30, a0
+ADDI   	a0, a0, 32
+ADDI   	t1, t1, 1
+BLT    	t1, t0, -24
+JALR   	zero, ra, 0